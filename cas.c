@@ -0,0 +1,249 @@
+#include "cas.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define TMP_PREFIX "tmp."
+
+// Serializes linking names to blobs against garbage collection, so a blob
+// is never removed between being found and gaining another link
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+static void xxh_stripe(cas_hash_t *hash, const unsigned char *p) {
+    hash->v[0] = xxh_round(hash->v[0], read64(p));
+    hash->v[1] = xxh_round(hash->v[1], read64(p + 8));
+    hash->v[2] = xxh_round(hash->v[2], read64(p + 16));
+    hash->v[3] = xxh_round(hash->v[3], read64(p + 24));
+}
+
+void cas_hash_init(cas_hash_t *hash) {
+    hash->v[0] = PRIME1 + PRIME2;
+    hash->v[1] = PRIME2;
+    hash->v[2] = 0;
+    hash->v[3] = -PRIME1;
+    hash->total = 0;
+    hash->memsize = 0;
+}
+
+void cas_hash_update(cas_hash_t *hash, const char *buf, size_t n) {
+    const unsigned char *p = (const unsigned char *) buf;
+    const unsigned char *end = p + n;
+    hash->total += n;
+    // Top up a partial stripe left over from the previous call
+    if (hash->memsize + n < 32) {
+        memcpy(hash->mem + hash->memsize, p, n);
+        hash->memsize += n;
+        return;
+    }
+    if (hash->memsize > 0) {
+        size_t fill = 32 - hash->memsize;
+        memcpy(hash->mem + hash->memsize, p, fill);
+        xxh_stripe(hash, hash->mem);
+        p += fill;
+        hash->memsize = 0;
+    }
+    while (end - p >= 32) {
+        xxh_stripe(hash, p);
+        p += 32;
+    }
+    memcpy(hash->mem, p, end - p);
+    hash->memsize = end - p;
+}
+
+uint64_t cas_hash_final(const cas_hash_t *hash) {
+    uint64_t h;
+    if (hash->total >= 32) {
+        h = rotl(hash->v[0], 1) + rotl(hash->v[1], 7) + rotl(hash->v[2], 12)
+            + rotl(hash->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh_merge(h, hash->v[i]);
+        }
+    } else {
+        h = hash->v[2] + PRIME5;
+    }
+    h += hash->total;
+    const unsigned char *p = hash->mem;
+    const unsigned char *end = p + hash->memsize;
+    while (end - p >= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t) read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Remove blobs with no links besides their own entry in CAS_DIR. Temporary
+// files belong to in-flight writers, so they are only removed at startup.
+static void collect(bool startup) {
+    DIR *dir = opendir(CAS_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char path[CAS_PATHLEN + 256];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        bool tmp = strncmp(entry->d_name, TMP_PREFIX, strlen(TMP_PREFIX)) == 0;
+        if (tmp && !startup) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", CAS_DIR, entry->d_name);
+        // Check the link count under the lock so a concurrent commit cannot
+        // link the blob between the check and the unlink
+        pthread_mutex_lock(&store_mutex);
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && (tmp || st.st_nlink == 1)) {
+            unlink(path);
+        }
+        pthread_mutex_unlock(&store_mutex);
+    }
+    closedir(dir);
+}
+
+int cas_init(void) {
+    if (mkdir(CAS_DIR, 0777) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    collect(true);
+    return 0;
+}
+
+void cas_collect(void) {
+    collect(false);
+}
+
+int cas_writer_open(cas_writer_t *writer, int id) {
+    snprintf(writer->tmp_path, CAS_PATHLEN, "%s/%s%d", CAS_DIR, TMP_PREFIX, id);
+    snprintf(writer->link_path, CAS_PATHLEN, "%s/%s%d.link", CAS_DIR, TMP_PREFIX, id);
+    cas_hash_init(&writer->hash);
+    writer->fd = open(writer->tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    return writer->fd;
+}
+
+// Compare the contents of fd against the file at path
+static bool same_contents(int fd, const char *path, char *scratch, size_t n) {
+    int other = open(path, O_RDONLY);
+    if (other == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        if (other != -1) {
+            close(other);
+        }
+        return false;
+    }
+    char *mine = scratch;
+    char *theirs = scratch + n / 2;
+    bool same = true;
+    while (same) {
+        ssize_t a = read(fd, mine, n / 2);
+        ssize_t b = a > 0 ? read(other, theirs, a) : read(other, theirs, 1);
+        if (a == -1 || b == -1 || a != b) {
+            same = false;
+        } else if (a == 0) {
+            break;
+        } else {
+            same = memcmp(mine, theirs, a) == 0;
+        }
+    }
+    close(other);
+    return same;
+}
+
+int cas_writer_commit(cas_writer_t *writer, const char *name, char *scratch, size_t n) {
+    struct stat st;
+    if (fstat(writer->fd, &st) == -1) {
+        cas_writer_abort(writer);
+        return -1;
+    }
+    char blob[CAS_PATHLEN];
+    snprintf(blob, CAS_PATHLEN, "%s/%016" PRIx64 "-%" PRIx64, CAS_DIR,
+        cas_hash_final(&writer->hash), (uint64_t) st.st_size);
+    int rc;
+    pthread_mutex_lock(&store_mutex);
+    if (link(blob, writer->link_path) == 0) {
+        // Blob already stored; our link keeps it alive while we verify it
+        pthread_mutex_unlock(&store_mutex);
+        if (same_contents(writer->fd, writer->link_path, scratch, n)) {
+            rc = rename(writer->link_path, name);
+        } else {
+            // Hash collision: keep a private copy outside the store
+            unlink(writer->link_path);
+            rc = rename(writer->tmp_path, name);
+        }
+    } else if (errno == ENOENT && link(writer->tmp_path, blob) == 0) {
+        // First copy of these contents becomes the blob
+        rc = rename(writer->tmp_path, name);
+        pthread_mutex_unlock(&store_mutex);
+    } else {
+        // Blob cannot be shared (e.g. EMLINK); keep a private copy
+        pthread_mutex_unlock(&store_mutex);
+        rc = rename(writer->tmp_path, name);
+    }
+    int saved_errno = errno;
+    unlink(writer->link_path);
+    unlink(writer->tmp_path);
+    close(writer->fd);
+    errno = saved_errno;
+    return rc;
+}
+
+void cas_writer_abort(cas_writer_t *writer) {
+    close(writer->fd);
+    unlink(writer->tmp_path);
+}
@@ -0,0 +1,90 @@
+/**
+ * @File cas.h
+ *
+ * Content-addressed blob store backing the deduplicating PUT mode.
+ * Blobs live in CAS_DIR named by the XXH64 hash and size of their
+ * contents. A served filename is a hard link to its blob, so identical
+ * payloads share one inode on disk and one copy in the page cache.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAS_DIR     ".cas"
+#define CAS_PATHLEN 64
+
+/** @struct cas_hash_t
+ *  @brief Streaming XXH64 state.
+ */
+typedef struct cas_hash {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char mem[32];
+    size_t memsize;
+} cas_hash_t;
+
+/** @struct cas_writer_t
+ *  @brief A blob being written. Callers write the body to fd and feed
+ *         the same bytes to hash, then commit it under a filename.
+ */
+typedef struct cas_writer {
+    int fd;
+    cas_hash_t hash;
+    char tmp_path[CAS_PATHLEN];
+    char link_path[CAS_PATHLEN];
+} cas_writer_t;
+
+/** @brief Resets hash to the XXH64 initial state with seed 0.
+ */
+void cas_hash_init(cas_hash_t *hash);
+
+/** @brief Feeds n bytes from buf into hash.
+ */
+void cas_hash_update(cas_hash_t *hash, const char *buf, size_t n);
+
+/** @brief Returns the XXH64 digest of everything fed into hash.
+ */
+uint64_t cas_hash_final(const cas_hash_t *hash);
+
+/** @brief Creates CAS_DIR if needed, removes temporary files left by a
+ *         previous run and collects unreferenced blobs. Must be called
+ *         before any writer is opened.
+ *
+ *  @return 0, indicating success, or -1, indicating an error. Sets
+ *          errno according to any errors that occur.
+ */
+int cas_init(void);
+
+/** @brief Removes every blob that is no longer linked from a filename.
+ *         Safe to call while writers are committing.
+ */
+void cas_collect(void);
+
+/** @brief Opens a fresh temporary file for writer. id must be unique
+ *         among concurrently open writers (e.g. the worker index).
+ *
+ *  @return The temporary file descriptor, or -1, indicating an error.
+ *          Sets errno according to any errors that occur.
+ */
+int cas_writer_open(cas_writer_t *writer, int id);
+
+/** @brief Publishes the written contents under name. If a blob with the
+ *         same contents exists, name is linked to it and the new copy is
+ *         dropped; otherwise the new copy becomes the blob. name is
+ *         replaced atomically, so readers see either the old or the new
+ *         contents. Closes the writer.
+ *
+ *  @param scratch A buffer used to verify a matching blob byte for byte.
+ *
+ *  @param n The size of scratch.
+ *
+ *  @return 0, indicating success, or -1, indicating an error. Sets
+ *          errno according to any errors that occur.
+ */
+int cas_writer_commit(cas_writer_t *writer, const char *name, char *scratch, size_t n);
+
+/** @brief Discards the written contents and closes the writer.
+ */
+void cas_writer_abort(cas_writer_t *writer);
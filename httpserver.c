@@ -1,7 +1,10 @@
 #include "helper_funcs.h"
 
+#include "cas.h"
 #include "queue.h"
 #include "rwlock.h"
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -14,6 +17,11 @@
 #include <unistd.h>
 
 #define BUFSIZE     4096
+#define IOBUFSIZE   65536
+#define ARENASIZE   1024
+#define CACHELINE   64
+#define GC_INTERVAL 60
+#define PUT_TMP     "_put." // Names never contain '_', so this cannot collide with a request
 #define REQEX       "^([a-zA-Z]{1,8}) /([a-zA-Z0-9.-]{1,63}) (HTTP/[0-9]\\.[0-9])\r\n"
 #define HEADEX      "([a-zA-Z0-9.-]{1,128}): ([ -~]{1,128})\r\n"
 #define OK          "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nOK\n"
@@ -32,9 +40,9 @@
     "Not Supported\n"
 
 typedef struct node {
-    char *filename;
     rwlock_t *rwlock;
     struct node *next;
+    char filename[]; // Stored inline so a node is a single allocation
 } node_t;
 
 typedef struct file_locks {
@@ -54,9 +62,9 @@ file_locks_t *new_file_locks() {
 
 node_t *add_node(file_locks_t *file_locks, char *filename) {
 
-    node_t *new_node = (node_t *) malloc(sizeof(node_t));
-    new_node->filename = (char *) malloc(sizeof(char) * (strlen(filename) + 1));
-    strcpy(new_node->filename, filename);
+    size_t len = strlen(filename);
+    node_t *new_node = (node_t *) malloc(sizeof(node_t) + len + 1);
+    memcpy(new_node->filename, filename, len + 1);
     new_node->rwlock = rwlock_new(N_WAY, 1);
     new_node->next = NULL;
     pthread_mutex_lock(&file_locks->mutex);
@@ -100,7 +108,218 @@ void file_write_unlock(file_locks_t *file_locks, char *filename) {
     writer_unlock(node->rwlock);
 }
 
+// Bump allocator for per-request scratch memory, reset between requests
+typedef struct arena {
+    char *base;
+    size_t size;
+    size_t used;
+} arena_t;
+
+void *arena_alloc(arena_t *arena, size_t n) {
+    // Keep every allocation aligned to a word boundary
+    n = (n + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (arena->used + n > arena->size) {
+        return NULL;
+    }
+    void *ptr = arena->base + arena->used;
+    arena->used += n;
+    return ptr;
+}
+
+void arena_reset(arena_t *arena) {
+    arena->used = 0;
+}
+
+// Per-worker state, allocated once when the thread starts so that the
+// request path itself never touches the heap
+typedef struct worker {
+    char buf[BUFSIZE + 1] __attribute__((aligned(CACHELINE))); // Request headers
+    char io_buf[IOBUFSIZE] __attribute__((aligned(CACHELINE))); // Bounce buffer for bodies
+    char arena_buf[ARENASIZE] __attribute__((aligned(CACHELINE))); // Backing store for arena
+    arena_t arena;
+    int id; // Unique per worker, names its temporary PUT files
+} worker_t;
+
+worker_t *new_worker() {
+    static int next_id = 0;
+    size_t size = (sizeof(worker_t) + CACHELINE - 1) & ~(size_t) (CACHELINE - 1);
+    worker_t *worker = (worker_t *) aligned_alloc(CACHELINE, size);
+    if (worker == NULL) {
+        return NULL;
+    }
+    worker->arena.base = worker->arena_buf;
+    worker->arena.size = ARENASIZE;
+    worker->arena.used = 0;
+    worker->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    return worker;
+}
+
+// Scan a run of between min and max characters accepted by in_set,
+// starting at pos. Returns the end of the run, or -1 if out of range.
+// Stops as soon as the run exceeds max.
+int scan_run(const char *buf, int pos, int min, int max, int (*in_set)(int)) {
+    int end = pos;
+    while (buf[end] != '\0' && in_set((unsigned char) buf[end])) {
+        if (++end - pos > max) {
+            return -1;
+        }
+    }
+    return end - pos < min ? -1 : end;
+}
+
+int is_token_char(int c) {
+    return isalnum(c) || c == '.' || c == '-';
+}
+
+int is_header_value_char(int c) {
+    return c >= ' ' && c <= '~';
+}
+
+// Hand-written equivalent of regexec() against REQEX. glibc's regexec
+// allocates on every call, so the hot path matches the grammar directly.
+int match_request_line(const char *buf, regmatch_t matches[4]) {
+    int end;
+    if ((end = scan_run(buf, 0, 1, 8, isalpha)) == -1 || buf[end] != ' ' || buf[end + 1] != '/') {
+        return REG_NOMATCH;
+    }
+    matches[1].rm_so = 0;
+    matches[1].rm_eo = end;
+    matches[2].rm_so = end + 2;
+    if ((end = scan_run(buf, matches[2].rm_so, 1, 63, is_token_char)) == -1 || buf[end] != ' ') {
+        return REG_NOMATCH;
+    }
+    matches[2].rm_eo = end;
+    const char *version = buf + end + 1;
+    if (strncmp(version, "HTTP/", 5) != 0 || !isdigit((unsigned char) version[5])
+        || version[6] != '.' || !isdigit((unsigned char) version[7]) || version[8] != '\r'
+        || version[9] != '\n') {
+        return REG_NOMATCH;
+    }
+    matches[3].rm_so = end + 1;
+    matches[3].rm_eo = end + 9;
+    matches[0].rm_so = 0;
+    matches[0].rm_eo = end + 11;
+    return 0;
+}
+
+// Hand-written equivalent of regexec() against HEADEX. Like regexec, the
+// match is unanchored and reports the leftmost header in buf. Every start
+// inside a run of key characters shares the run's end, so each run is
+// scanned once and the search stays linear.
+int match_header(const char *buf, regmatch_t matches[3]) {
+    int start = 0;
+    while (buf[start] != '\0') {
+        int key_end = start;
+        while (buf[key_end] != '\0' && is_token_char((unsigned char) buf[key_end])) {
+            key_end++;
+        }
+        if (key_end == start) {
+            start++;
+            continue;
+        }
+        if (buf[key_end] != ':') {
+            start = key_end;
+            continue;
+        }
+        // The leftmost key that fits ends at the colon
+        if (key_end - start > 128) {
+            start = key_end - 128;
+        }
+        int value_end = buf[key_end + 1] == ' '
+                            ? scan_run(buf, key_end + 2, 1, 128, is_header_value_char)
+                            : -1;
+        if (value_end == -1 || buf[value_end] != '\r' || buf[value_end + 1] != '\n') {
+            start = key_end;
+            continue;
+        }
+        matches[0].rm_so = start;
+        matches[0].rm_eo = value_end + 2;
+        matches[1].rm_so = start;
+        matches[1].rm_eo = key_end;
+        matches[2].rm_so = key_end + 2;
+        matches[2].rm_eo = value_end;
+        return 0;
+    }
+    return REG_NOMATCH;
+}
+
+// Write n as decimal digits into buf, returning the number of characters
+// written (buf must hold at least 20 bytes)
+size_t utoa(uint64_t n, char *buf) {
+    char tmp[20];
+    size_t len = 0;
+    do {
+        tmp[len++] = (char) ('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = tmp[len - 1 - i];
+    }
+    return len;
+}
+
+// Send a constant response string without going through stdio
+void send_response(int sock_fd, const char *response) {
+    write_n_bytes(sock_fd, (char *) response, strlen(response));
+}
+
+// Same contract as read_until, but reads straight into the worker's
+// header buffer instead of allocating a scratch copy per call
+ssize_t read_headers(worker_t *worker, int fd) {
+    size_t total = 0;
+    worker->buf[0] = '\0';
+    while (total < BUFSIZE) {
+        ssize_t bytes_read = read(fd, worker->buf + total, BUFSIZE - total);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        // Only rescan the new bytes plus enough overlap to catch a split terminator
+        size_t from = total < 3 ? 0 : total - 3;
+        total += bytes_read;
+        worker->buf[total] = '\0';
+        if (strstr(worker->buf + from, "\r\n\r\n") != NULL) {
+            break;
+        }
+    }
+    return total;
+}
+
+// Same contract as pass_n_bytes, but uses the worker's bounce buffer
+// instead of allocating one per call. If hash is not NULL, every byte
+// passed is also fed into it.
+ssize_t pass_bytes(worker_t *worker, int src, int dst, size_t n, cas_hash_t *hash) {
+    size_t total = 0;
+    while (total < n) {
+        size_t chunk = n - total < IOBUFSIZE ? n - total : IOBUFSIZE;
+        ssize_t bytes_read = read(src, worker->io_buf, chunk);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        if (write_n_bytes(dst, worker->io_buf, bytes_read) == -1) {
+            return -1;
+        }
+        if (hash != NULL) {
+            cas_hash_update(hash, worker->io_buf, bytes_read);
+        }
+        total += bytes_read;
+    }
+    return total;
+}
+
 typedef struct Request {
+    worker_t *worker; // Worker handling this request
     int sock_fd; // Socket file descriptor
     char *version; // HTTP version
     char *command; // Command (GET, PUT)
@@ -115,38 +334,40 @@ int parse_request(Request *request, char *buf, ssize_t bytes_read);
 int process_request(Request *request);
 int process_get(Request *request);
 int process_put(Request *request);
+int process_put_dedup(Request *request);
 void *process_in_thread();
+void *collect_in_thread();
+void remove_put_files();
 
 queue_t *queue;
 file_locks_t *file_locks;
+bool dedup = false; // Store PUT bodies in the content-addressed store
 
 int main(int argc, char *argv[]) {
-    if (argc != 4 && argc != 2) {
-        return EXIT_FAILURE;
-    }
     int threads_count = 4;
     int port;
-    if (argc == 2) {
-        port = strtol(argv[1], NULL, 10);
-        if (errno == EINVAL) {
-            fprintf(stderr, "Invalid Port\n");
-            return EXIT_FAILURE;
-        }
-    } else if (argc == 4) {
-        if (strcmp(argv[1], "-t") != 0) {
-            return EXIT_FAILURE;
-        }
-        threads_count = strtol(argv[2], NULL, 10);
-        if (errno == EINVAL) {
-            fprintf(stderr, "Invalid threads\n");
-            return EXIT_FAILURE;
-        }
-        port = strtol(argv[3], NULL, 10);
-        if (errno == EINVAL) {
-            fprintf(stderr, "Invalid Port\n");
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d")) != -1) {
+        if (opt == 't') {
+            threads_count = strtol(optarg, NULL, 10);
+            if (errno == EINVAL) {
+                fprintf(stderr, "Invalid threads\n");
+                return EXIT_FAILURE;
+            }
+        } else if (opt == 'd') {
+            dedup = true;
+        } else {
             return EXIT_FAILURE;
         }
     }
+    if (optind != argc - 1) {
+        return EXIT_FAILURE;
+    }
+    port = strtol(argv[optind], NULL, 10);
+    if (errno == EINVAL) {
+        fprintf(stderr, "Invalid Port\n");
+        return EXIT_FAILURE;
+    }
 
     Listener_Socket socket;
     // Convert port number from string to integer
@@ -161,6 +382,15 @@ int main(int argc, char *argv[]) {
     }
     queue = queue_new(threads_count);
     file_locks = new_file_locks();
+    remove_put_files();
+    if (dedup) {
+        if (cas_init() == -1) {
+            fprintf(stderr, "Unable to Initialize Store\n");
+            return EXIT_FAILURE;
+        }
+        pthread_t collector;
+        pthread_create(&collector, NULL, collect_in_thread, NULL);
+    }
 
     pthread_t threads[threads_count];
 
@@ -180,19 +410,50 @@ int main(int argc, char *argv[]) {
     return EXIT_SUCCESS;
 }
 
+// Remove temporary PUT files left behind if a previous run died mid-request
+void remove_put_files() {
+    DIR *dir = opendir(".");
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, PUT_TMP, strlen(PUT_TMP)) == 0) {
+            unlink(entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+// Periodically remove blobs no longer referenced by any filename
+void *collect_in_thread() {
+    while (true) {
+        sleep(GC_INTERVAL);
+        cas_collect();
+    }
+    return NULL;
+}
+
 void *process_in_thread() {
+    worker_t *worker = new_worker();
+    if (worker == NULL) {
+        fprintf(stderr, "Unable to Allocate Worker\n");
+        return NULL;
+    }
+    char *buf = worker->buf;
     while (true) {
         uintptr_t intptr;
         queue_pop(queue, (void **) &intptr);
         int sock_fd = (int) intptr;
+        arena_reset(&worker->arena);
         Request request;
+        request.worker = worker;
         request.sock_fd = sock_fd;
-        char buf[BUFSIZE + 1] = { '\0' };
         // Read the request until the end of headers
-        ssize_t bytes_read = read_until(sock_fd, buf, BUFSIZE, "\r\n\r\n");
+        ssize_t bytes_read = read_headers(worker, sock_fd);
         if (bytes_read == -1) {
             // Write bad request response if reading fails
-            dprintf(request.sock_fd, BAD_REQUEST);
+            send_response(request.sock_fd, BAD_REQUEST);
             return NULL;
         }
         if (parse_request(&request, buf, bytes_read) != EXIT_FAILURE) {
@@ -208,15 +469,11 @@ void *process_in_thread() {
 int parse_request(Request *request, char *buf, ssize_t bytes_read) {
     request->request_ID = 0;
     int offset = 0;
-    // Regular expression structure
-    regex_t re;
     // Array to store matches
     regmatch_t matches[4];
     int rc;
-    // Compile the regular expression pattern for HTTP requests
-    rc = regcomp(&re, REQEX, REG_EXTENDED);
     // Execute the regular expression matching
-    rc = regexec(&re, buf, 4, matches, 0);
+    rc = match_request_line(buf, matches);
     if (rc == 0) {
         // If match found
         // Set the command in the request structure
@@ -235,17 +492,13 @@ int parse_request(Request *request, char *buf, ssize_t bytes_read) {
     } else {
         // If no match found
         // Send bad request response
-        dprintf(request->sock_fd, BAD_REQUEST);
-        // Free the regular expression memory
-        regfree(&re);
+        send_response(request->sock_fd, BAD_REQUEST);
         return EXIT_FAILURE;
     }
     // Initialize content length to -1
     request->content_length = -1;
-    // Compile the regular expression pattern for HTTP headers
-    rc = regcomp(&re, HEADEX, REG_EXTENDED);
     // Execute the regular expression matching for headers
-    rc = regexec(&re, buf, 3, matches, 0);
+    rc = match_header(buf, matches);
     // Loop through all header matches
     while (rc == 0) {
         buf[matches[1].rm_eo] = '\0';
@@ -254,19 +507,19 @@ int parse_request(Request *request, char *buf, ssize_t bytes_read) {
         if (strncmp(buf, "Content-Length", 14) == 0) {
             int value = strtol(buf + matches[2].rm_so, NULL, 10);
             if (errno == EINVAL) {
-                dprintf(request->sock_fd, BAD_REQUEST);
+                send_response(request->sock_fd, BAD_REQUEST);
             }
             request->content_length = value;
         } else if (strncmp(buf, "Request-Id", 11) == 0) {
             int value = strtol(buf + matches[2].rm_so, NULL, 10);
             if (errno == EINVAL) {
-                dprintf(request->sock_fd, BAD_REQUEST);
+                send_response(request->sock_fd, BAD_REQUEST);
             }
             request->request_ID = value;
         }
         buf += matches[2].rm_eo + 2;
         offset += matches[2].rm_eo + 2;
-        rc = regexec(&re, buf, 3, matches, 0);
+        rc = match_header(buf, matches);
     }
 
     if ((rc != 0) && (buf[0] == '\r' && buf[1] == '\n')) {
@@ -276,11 +529,9 @@ int parse_request(Request *request, char *buf, ssize_t bytes_read) {
         // Calculate the remaining bytes after headers
         request->remaining_bytes = bytes_read - offset;
     } else if (rc != 0) {
-        dprintf(request->sock_fd, BAD_REQUEST);
-        regfree(&re);
+        send_response(request->sock_fd, BAD_REQUEST);
         return EXIT_FAILURE;
     }
-    regfree(&re);
     return EXIT_SUCCESS;
 }
 
@@ -289,7 +540,7 @@ int process_request(Request *request) {
     // If HTTP version is not supported
     if (strncmp(request->version, "HTTP/1.1", 8) != 0) {
         // Send version not supported response
-        dprintf(request->sock_fd, VERSION_NOT_SUPPORTED);
+        send_response(request->sock_fd, VERSION_NOT_SUPPORTED);
         return EXIT_FAILURE;
     } else if (strncmp(request->command, "GET", 3) == 0) {
         // Process GET request
@@ -299,7 +550,7 @@ int process_request(Request *request) {
         return process_put(request);
     } else {
         // Send not implemented response
-        dprintf(request->sock_fd, NOT_IMPLEMENTED);
+        send_response(request->sock_fd, NOT_IMPLEMENTED);
         return EXIT_FAILURE;
     }
 }
@@ -308,21 +559,21 @@ int process_get(Request *request) {
     // If content length is specified in GET request
     if (request->content_length != -1) {
         // Send bad request response
-        dprintf(request->sock_fd, BAD_REQUEST);
+        send_response(request->sock_fd, BAD_REQUEST);
 
         return EXIT_FAILURE;
     }
     // If remaining bytes are present after headers
     if (request->remaining_bytes > 0) {
         // Send bad request response
-        dprintf(request->sock_fd, BAD_REQUEST);
+        send_response(request->sock_fd, BAD_REQUEST);
         return EXIT_FAILURE;
     }
     int fd; // File descriptor
     // If file is a directory
     if ((fd = open(request->file_name, O_RDONLY | O_DIRECTORY)) != -1) {
         // Send forbidden response
-        dprintf(request->sock_fd, FORBIDDEN);
+        send_response(request->sock_fd, FORBIDDEN);
         fprintf(stderr, "GET,/%s,403,%d\n", request->file_name, request->request_ID);
         return EXIT_FAILURE;
     }
@@ -332,16 +583,16 @@ int process_get(Request *request) {
         // If file not found
         if (errno == ENOENT) {
             // Send not found response
-            dprintf(request->sock_fd, NOT_FOUND);
+            send_response(request->sock_fd, NOT_FOUND);
             fprintf(stderr, "GET,/%s,404,%d\n", request->file_name, request->request_ID);
             // If access is denied
         } else if (errno == EACCES) {
             // Send forbidden response
             fprintf(stderr, "GET,/%s,403,%d\n", request->file_name, request->request_ID);
-            dprintf(request->sock_fd, FORBIDDEN);
+            send_response(request->sock_fd, FORBIDDEN);
         } else {
             // Send internal server error response
-            dprintf(request->sock_fd, INTERNAL_SERVER_ERROR);
+            send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
             fprintf(stderr, "GET,/%s,500,%d\n", request->file_name, request->request_ID);
         }
         file_read_unlock(file_locks, request->file_name);
@@ -354,14 +605,24 @@ int process_get(Request *request) {
     // Get file size
     off_t size = st.st_size;
     // Send OK response with content length
-    dprintf(request->sock_fd, "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n\r\n", size);
+    static const char ok_head[] = "HTTP/1.1 200 OK\r\nContent-Length: ";
+    // Header, up to 20 digits of length, and the blank line. This is the only
+    // allocation from the freshly reset arena, so it cannot fail.
+    _Static_assert(sizeof(ok_head) + 20 + 4 <= ARENASIZE, "GET header must fit in the arena");
+    char *head = arena_alloc(&request->worker->arena, sizeof(ok_head) + 20 + 4);
+    size_t len = sizeof(ok_head) - 1;
+    memcpy(head, ok_head, len);
+    len += utoa((uint64_t) size, head + len);
+    memcpy(head + len, "\r\n\r\n", 4);
+    len += 4;
+    write_n_bytes(request->sock_fd, head, len);
     fprintf(stderr, "GET,/%s,200,%d\n", request->file_name, request->request_ID);
     // Write file contents to socket
-    int bytes_written = pass_n_bytes(fd, request->sock_fd, size);
+    int bytes_written = pass_bytes(request->worker, fd, request->sock_fd, size, NULL);
     // If error in writing
     if (bytes_written == -1) {
         // Send internal server error response
-        dprintf(request->sock_fd, INTERNAL_SERVER_ERROR);
+        send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
         file_read_unlock(file_locks, request->file_name);
         return EXIT_FAILURE;
     }
@@ -375,7 +636,7 @@ int process_put(Request *request) {
     // If content length is not specified in PUT request
     if (request->content_length == -1) {
         // Send bad request response
-        dprintf(request->sock_fd, BAD_REQUEST);
+        send_response(request->sock_fd, BAD_REQUEST);
         return EXIT_FAILURE;
     }
     int fd;
@@ -383,10 +644,13 @@ int process_put(Request *request) {
     // If file is a directory
     if ((fd = open(request->file_name, O_WRONLY | O_DIRECTORY, 0666)) != -1) {
         // Send forbidden response
-        dprintf(request->sock_fd, FORBIDDEN);
+        send_response(request->sock_fd, FORBIDDEN);
         fprintf(stderr, "PUT,/%s,403,%d\n", request->file_name, request->request_ID);
         return EXIT_FAILURE;
     }
+    if (dedup) {
+        return process_put_dedup(request);
+    }
     file_write_lock(file_locks, request->file_name);
     // If file cannot be opened or created
     if ((fd = open(request->file_name, O_WRONLY | O_CREAT | O_EXCL, 0666)) == -1) {
@@ -397,13 +661,13 @@ int process_put(Request *request) {
             // If access is denied
         } else if (errno == EACCES) {
             // Send forbidden response
-            dprintf(request->sock_fd, FORBIDDEN);
+            send_response(request->sock_fd, FORBIDDEN);
             fprintf(stderr, "PUT,/%s,403,%d\n", request->file_name, request->request_ID);
             file_write_unlock(file_locks, request->file_name);
             return EXIT_FAILURE;
         } else {
             // Send internal server error response
-            dprintf(request->sock_fd, INTERNAL_SERVER_ERROR);
+            send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
             fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
             file_write_unlock(file_locks, request->file_name);
             return EXIT_FAILURE;
@@ -413,16 +677,31 @@ int process_put(Request *request) {
         // Set status code to 201
         status_code = 201;
     }
+    // Temporary file to rename over the name, if it must not be written in place
+    char tmp_path[32] = "";
     // If file already exists
     if (status_code == 200) {
-        if ((fd = open(request->file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+        struct stat st;
+        // If the name shares its inode with other names (e.g. a blob linked
+        // by a -d run), truncating it would rewrite all of them
+        if (stat(request->file_name, &st) == 0 && st.st_nlink > 1) {
+            snprintf(tmp_path, sizeof(tmp_path), PUT_TMP "%d", request->worker->id);
+            if (access(request->file_name, W_OK) == 0) {
+                fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            } else {
+                fd = -1;
+            }
+        } else {
+            fd = open(request->file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        }
+        if (fd == -1) {
             if (errno == EACCES) {
-                dprintf(request->sock_fd, FORBIDDEN);
+                send_response(request->sock_fd, FORBIDDEN);
                 fprintf(stderr, "PUT,/%s,403,%d\n", request->file_name, request->request_ID);
                 file_write_unlock(file_locks, request->file_name);
                 return EXIT_FAILURE;
             } else {
-                dprintf(request->sock_fd, INTERNAL_SERVER_ERROR);
+                send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
                 fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
                 file_write_unlock(file_locks, request->file_name);
                 return EXIT_FAILURE;
@@ -434,32 +713,116 @@ int process_put(Request *request) {
     // If error in writing
     if (bytes == -1) {
         // Send internal server error response
-        dprintf(request->sock_fd, INTERNAL_SERVER_ERROR);
+        send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
         fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
         close(fd);
+        if (tmp_path[0] != '\0') {
+            unlink(tmp_path);
+        }
         file_write_unlock(file_locks, request->file_name);
         return EXIT_FAILURE;
     }
     // Calculate size of remaining data
     int remaining = request->content_length - request->remaining_bytes;
     // Write remaining data to file
-    bytes = pass_n_bytes(request->sock_fd, fd, remaining);
+    bytes = pass_bytes(request->worker, request->sock_fd, fd, remaining, NULL);
     // If error in writing
     if (bytes == -1) {
-        dprintf(request->sock_fd, INTERNAL_SERVER_ERROR);
+        send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
+        close(fd);
+        if (tmp_path[0] != '\0') {
+            unlink(tmp_path);
+        }
+        file_write_unlock(file_locks, request->file_name);
+        return EXIT_FAILURE;
+    }
+    // Replace the shared name with the new file
+    if (tmp_path[0] != '\0' && rename(tmp_path, request->file_name) == -1) {
+        send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
+        fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
         close(fd);
+        unlink(tmp_path);
         file_write_unlock(file_locks, request->file_name);
         return EXIT_FAILURE;
     }
 
     if (status_code == 201) {
-        dprintf(request->sock_fd, CREATED);
+        send_response(request->sock_fd, CREATED);
         fprintf(stderr, "PUT,/%s,201,%d\n", request->file_name, request->request_ID);
     } else {
-        dprintf(request->sock_fd, OK);
+        send_response(request->sock_fd, OK);
         fprintf(stderr, "PUT,/%s,200,%d\n", request->file_name, request->request_ID);
     }
     close(fd);
     file_write_unlock(file_locks, request->file_name);
     return EXIT_SUCCESS;
 }
+// Process the PUT request through the content-addressed store. The body
+// is hashed while it is written to a temporary file, then the filename is
+// atomically pointed at the matching blob.
+int process_put_dedup(Request *request) {
+    file_write_lock(file_locks, request->file_name);
+    int status_code = 201;
+    // If file already exists
+    if (access(request->file_name, F_OK) == 0) {
+        status_code = 200;
+        // If access is denied
+        if (access(request->file_name, W_OK) == -1) {
+            send_response(request->sock_fd, FORBIDDEN);
+            fprintf(stderr, "PUT,/%s,403,%d\n", request->file_name, request->request_ID);
+            file_write_unlock(file_locks, request->file_name);
+            return EXIT_FAILURE;
+        }
+    }
+    cas_writer_t writer;
+    if (cas_writer_open(&writer, request->worker->id) == -1) {
+        // If access is denied
+        if (errno == EACCES) {
+            send_response(request->sock_fd, FORBIDDEN);
+            fprintf(stderr, "PUT,/%s,403,%d\n", request->file_name, request->request_ID);
+        } else {
+            send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
+            fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
+        }
+        file_write_unlock(file_locks, request->file_name);
+        return EXIT_FAILURE;
+    }
+    // Write message body to the store, then the remaining data
+    int bytes = write_n_bytes(writer.fd, request->message_body, request->remaining_bytes);
+    if (bytes != -1) {
+        cas_hash_update(&writer.hash, request->message_body, request->remaining_bytes);
+        int remaining = request->content_length - request->remaining_bytes;
+        bytes = pass_bytes(request->worker, request->sock_fd, writer.fd, remaining, &writer.hash);
+    }
+    // If error in writing
+    if (bytes == -1) {
+        send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
+        fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
+        cas_writer_abort(&writer);
+        file_write_unlock(file_locks, request->file_name);
+        return EXIT_FAILURE;
+    }
+    // Point the filename at the stored contents
+    if (cas_writer_commit(&writer, request->file_name, request->worker->io_buf, IOBUFSIZE)
+        == -1) {
+        // If access is denied
+        if (errno == EACCES) {
+            send_response(request->sock_fd, FORBIDDEN);
+            fprintf(stderr, "PUT,/%s,403,%d\n", request->file_name, request->request_ID);
+        } else {
+            send_response(request->sock_fd, INTERNAL_SERVER_ERROR);
+            fprintf(stderr, "PUT,/%s,500,%d\n", request->file_name, request->request_ID);
+        }
+        file_write_unlock(file_locks, request->file_name);
+        return EXIT_FAILURE;
+    }
+    if (status_code == 201) {
+        send_response(request->sock_fd, CREATED);
+        fprintf(stderr, "PUT,/%s,201,%d\n", request->file_name, request->request_ID);
+    } else {
+        send_response(request->sock_fd, OK);
+        fprintf(stderr, "PUT,/%s,200,%d\n", request->file_name, request->request_ID);
+    }
+    file_write_unlock(file_locks, request->file_name);
+    return EXIT_SUCCESS;
+}
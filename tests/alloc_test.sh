@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+#
+# Asserts that steady-state GET and PUT requests make no heap allocations.
+# Usage: tests/alloc_test.sh <httpserver> <malloc_count.so> [requests]
+
+set -u
+
+SERVER=$(realpath "$1")
+PRELOAD=$(realpath "$2")
+REQUESTS=${3:-20}
+PORT=$((20000 + RANDOM % 20000))
+
+WORKDIR=$(mktemp -d)
+COUNT_FILE="$WORKDIR/count"
+trap 'kill "$PID" 2>/dev/null; rm -rf "$WORKDIR"' EXIT
+
+cd "$WORKDIR" || exit 1
+MALLOC_COUNT_FILE="$COUNT_FILE" LD_PRELOAD="$PRELOAD" "$SERVER" -t 2 "$PORT" 2>/dev/null &
+PID=$!
+
+# Send one raw request and print the response
+request() {
+    exec 3<>"/dev/tcp/127.0.0.1/$PORT" || return 1
+    printf '%b' "$1" >&3
+    cat <&3
+    exec 3<&-
+}
+
+put() {
+    request "PUT /$1 HTTP/1.1\r\nContent-Length: ${#2}\r\nRequest-Id: 1\r\n\r\n$2"
+}
+
+get() {
+    request "GET /$1 HTTP/1.1\r\nRequest-Id: 1\r\n\r\n"
+}
+
+count() {
+    rm -f "$COUNT_FILE"
+    kill -USR1 "$PID"
+    for _ in $(seq 50); do
+        [ -s "$COUNT_FILE" ] && break
+        sleep 0.1
+    done
+    cat "$COUNT_FILE"
+}
+
+for _ in $(seq 50); do
+    get missing >/dev/null 2>&1 && break
+    sleep 0.1
+done
+
+# Warm up: the first PUT creates the file's lock node, and the first requests
+# trigger libc's one-time lazy setup
+for _ in 1 2 3 4; do
+    put file "warm up body" >/dev/null
+    get file >/dev/null
+done
+
+BEFORE=$(count)
+for _ in $(seq "$REQUESTS"); do
+    put file "steady state body" | grep -q "200 OK" || { echo "FAIL: PUT"; exit 1; }
+    get file | grep -q "steady state body" || { echo "FAIL: GET"; exit 1; }
+done
+AFTER=$(count)
+
+if [ "$BEFORE" != "$AFTER" ]; then
+    echo "FAIL: $((AFTER - BEFORE)) allocations over $((REQUESTS * 2)) requests"
+    exit 1
+fi
+echo "PASS: 0 allocations over $((REQUESTS * 2)) requests"